@@ -1,6 +1,12 @@
 #include "aabb.h"
 
 bool AABB::hit(const ray &r, const double &t_min, const double &t_max) const {
+    double t_enter;
+    return hit(r, t_min, t_max, t_enter);
+}
+
+bool AABB::hit(const ray &r, const double &t_min, const double &t_max,
+               double &t_enter) const {
 
     double min_diff[3], max_diff[3];
     double min = t_min;
@@ -16,10 +22,30 @@ bool AABB::hit(const ray &r, const double &t_min, const double &t_max) const {
     max_diff[2] = (m_maxPoint.z - r.origin().z) / r.direction().z;
 
     for (int a = 0; a < 3; a++) {
-        min = fmax(fmin(min_diff[a], max_diff[a]), t_min);
-        max = fmin(fmax(min_diff[a], max_diff[a]), t_max);
-        if (max <= min)
+        min = fmax(fmin(min_diff[a], max_diff[a]), min);
+        max = fmin(fmax(min_diff[a], max_diff[a]), max);
+        if (max < min)
             return false;
     }
+    t_enter = min;
     return true;
+}
+
+AABB AABB::empty() {
+    return AABB(point3(INFINITY, INFINITY, INFINITY),
+                point3(-INFINITY, -INFINITY, -INFINITY));
+}
+
+void AABB::expand(const point3 &p) {
+    m_minPoint.x = fmin(m_minPoint.x, p.x);
+    m_minPoint.y = fmin(m_minPoint.y, p.y);
+    m_minPoint.z = fmin(m_minPoint.z, p.z);
+    m_maxPoint.x = fmax(m_maxPoint.x, p.x);
+    m_maxPoint.y = fmax(m_maxPoint.y, p.y);
+    m_maxPoint.z = fmax(m_maxPoint.z, p.z);
+}
+
+void AABB::expand(const AABB &box) {
+    expand(box.m_minPoint);
+    expand(box.m_maxPoint);
 }
\ No newline at end of file
@@ -1,6 +1,6 @@
 #pragma once
 
-#include "hittable.h"
+#include "ray.h"
 #include "vec3.h"
 
 class AABB {
@@ -14,6 +14,14 @@ class AABB {
 
     virtual bool hit(const ray &r, const double &t_min,
                      const double &t_max) const;
+    // Also sets t_enter to where the ray enters the box, clamped to t_min.
+    bool hit(const ray &r, const double &t_min, const double &t_max,
+             double &t_enter) const;
+
+    // Box that contains nothing, any expand() call replaces its bounds.
+    static AABB empty();
+    void expand(const point3 &p);
+    void expand(const AABB &box);
 
     point3 m_minPoint;
     point3 m_maxPoint;
@@ -0,0 +1,244 @@
+#include "benchmark.h"
+#include "image.h"
+#include "numa.h"
+#include "render.h"
+#include "scene.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <random>
+#include <string>
+#include <vector>
+
+static const int REFERENCE_SAMPLES = 16;
+static const int FRAMES = 4;
+
+static double best_time(const Scene &scene, const RenderOptions &options,
+                        const int repeats) {
+    double best = -1;
+    for (int i = 0; i < repeats; ++i) {
+        Image img(scene.camera.nx, scene.camera.ny);
+        double seconds = raytracing_threaded(scene, img, options);
+        if (best < 0 || seconds < best)
+            best = seconds;
+    }
+    return best;
+}
+
+static double channel(const double v) {
+    return fmax(0.0, fmin(255.0, static_cast<int>(v)));
+}
+
+// Peak signal to noise ratio of the exported 8 bit values in dB.
+static double psnr(const Image &img, const Image &ref) {
+    double mse = 0;
+    for (int j = 0; j < img.height(); ++j) {
+        for (int i = 0; i < img.width(); ++i) {
+            color a = img.get_pixel(i, j);
+            color b = ref.get_pixel(i, j);
+            mse += pow(channel(a.x) - channel(b.x), 2) +
+                   pow(channel(a.y) - channel(b.y), 2) +
+                   pow(channel(a.z) - channel(b.z), 2);
+        }
+    }
+    mse /= 3.0 * img.width() * img.height();
+    return mse > 0 ? 10 * log10(255 * 255 / mse) : INFINITY;
+}
+
+static void report(std::ostream &out, const std::string &name,
+                   const double seconds, const double baseline) {
+    out << "  " << name << std::string(32 - name.size(), ' ') << seconds
+        << " s  (" << baseline / seconds << "x)\n";
+}
+
+static double elapsed_ms(
+    const std::chrono::high_resolution_clock::time_point &start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::high_resolution_clock::now() - start)
+               .count() /
+           1000.0;
+}
+
+// Largest difference of the exported 8 bit values of a pixel, and the number
+// of pixels where it exceeds threshold.
+static int max_difference(const Image &img, const Image &ref,
+                          const int threshold, int &count) {
+    int worst = 0;
+    count = 0;
+    for (int j = 0; j < img.height(); ++j) {
+        for (int i = 0; i < img.width(); ++i) {
+            color a = img.get_pixel(i, j);
+            color b = ref.get_pixel(i, j);
+            int d = static_cast<int>(
+                fmax(fabs(channel(a.x) - channel(b.x)),
+                     fmax(fabs(channel(a.y) - channel(b.y)),
+                          fabs(channel(a.z) - channel(b.z)))));
+            worst = std::max(worst, d);
+            if (d > threshold)
+                ++count;
+        }
+    }
+    return worst;
+}
+
+// Memory, render time and image difference of the compact geometry against
+// the full precision scene.
+static bool compact_report(const Scene &scene, const char *path,
+                           std::ostream &out) {
+    Scene compact;
+    if (!scene_from_xml_file(compact, path, Geometry::Compact))
+        return false;
+
+    RenderOptions options;
+    options.verbose = false;
+    Image ref(scene.camera.nx, scene.camera.ny);
+    Image img(scene.camera.nx, scene.camera.ny);
+    double full_time = raytracing_threaded(scene, ref, options);
+    double compact_time = raytracing_threaded(compact, img, options);
+
+    int count;
+    int worst = max_difference(img, ref, 8, count);
+    out << "Compact geometry:\n"
+        << "  memory " << scene.memory_usage() / (1024.0 * 1024.0) << " MB -> "
+        << compact.memory_usage() / (1024.0 * 1024.0) << " MB, render "
+        << full_time << " s -> " << compact_time << " s\n"
+        << "  image PSNR " << psnr(img, ref) << " dB, largest difference "
+        << worst << ", " << count << " pixels differ by more than 8\n";
+
+    for (auto o : compact.hittables)
+        delete o;
+    return true;
+}
+
+// Number of camera rays on a coarse pixel grid whose closest hit differs
+// between the two scenes.
+static int mismatching_hits(const Scene &a, const Scene &b) {
+    int mismatches = 0;
+    for (int j = 0; j < a.camera.ny; j += 8) {
+        for (int i = 0; i < a.camera.nx; i += 8) {
+            ray r = a.camera.ray_to_pixel(i, j);
+            HitRecord ra, rb;
+            bool ha = a.hit(r, 0, INFINITY, ra);
+            bool hb = b.hit(r, 0, INFINITY, rb);
+            if (ha != hb || (ha && fabs(ra.t - rb.t) > 1e-9 * fmax(1, ra.t)))
+                ++mismatches;
+        }
+    }
+    return mismatches;
+}
+
+// Animates the vertices of the scene along a wave, refits it with
+// Scene::update_vertices() and compares it with a scene whose hierarchies
+// are rebuilt from scratch for every frame. The last frame shuffles the
+// vertices, which has to trigger the rebuild fallback.
+static bool animation_report(Scene &scene, const char *path,
+                             std::ostream &out) {
+    Scene rebuilt;
+    if (!scene_from_xml_file(rebuilt, path))
+        return false;
+
+    const std::vector<point3> original = scene.vertices;
+    AABB bounds = AABB::empty();
+    for (auto &v : original)
+        bounds.expand(v);
+    const double extent = (bounds.m_maxPoint - bounds.m_minPoint).len();
+
+    out << "Animated refit, " << original.size() << " vertices:\n"
+        << "  frame  refit ms  rebuild ms  rebuilt meshes  mismatches\n";
+    for (int frame = 1; frame <= FRAMES + 1; ++frame) {
+        std::vector<point3> positions = original;
+        if (frame <= FRAMES) {
+            for (auto &p : positions) {
+                double phase = frame + 8 * (p.x + p.y + p.z) / extent;
+                p += 0.01 * extent * vec3(sin(phase), cos(phase), sin(-phase));
+            }
+        } else {
+            std::minstd_rand rng(1);
+            std::shuffle(positions.begin(), positions.end(), rng);
+        }
+
+        size_t n_rebuilt = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        if (!scene.update_vertices(positions, 1.5, &n_rebuilt))
+            return false;
+        double refit_ms = elapsed_ms(start);
+
+        start = std::chrono::high_resolution_clock::now();
+        rebuilt.vertices = positions;
+        for (auto o : rebuilt.hittables)
+            o->initBoundingBox();
+        double rebuild_ms = elapsed_ms(start);
+
+        out << std::fixed << std::setprecision(2) << std::setw(7) << frame
+            << std::setw(10) << refit_ms << std::setw(12) << rebuild_ms
+            << std::setw(16) << n_rebuilt << std::setw(12)
+            << mismatching_hits(scene, rebuilt) << "\n";
+        out.unsetf(std::ios::floatfield);
+    }
+
+    return scene.update_vertices(original);
+}
+
+bool run_benchmark(const char *path, const int repeats, std::ostream &out) {
+    std::vector<NumaNode> nodes = numa_topology();
+    out << "NUMA placement, " << nodes.size() << " node(s):\n";
+    for (auto &node : nodes)
+        out << "  node " << node.id << ": " << node.cpus.size() << " cpus\n";
+
+    Scene scene;
+    if (!scene_from_xml_file(scene, path))
+        return false;
+
+    // The interleaved copy has to be loaded while the policy is active.
+    Scene interleaved;
+    bool interleave = interleave_allocations(nodes);
+    bool loaded = scene_from_xml_file(interleaved, path);
+    interleave_allocations(std::vector<NumaNode>());
+    if (!loaded)
+        return false;
+
+    RenderOptions options;
+    options.verbose = false;
+    double baseline = best_time(scene, options, repeats);
+    report(out, "unpinned, shared scene", baseline, baseline);
+
+    options.pin_threads = true;
+    report(out, "pinned, shared scene", best_time(scene, options, repeats),
+           baseline);
+    if (interleave)
+        report(out, "pinned, interleaved scene",
+               best_time(interleaved, options, repeats), baseline);
+    else
+        out << "  pinned, interleaved scene       unsupported\n";
+
+    options.replicate_scene = true;
+    report(out, "pinned, scene per node", best_time(scene, options, repeats),
+           baseline);
+
+    if (!compact_report(scene, path, out))
+        return false;
+
+    const int nx = scene.camera.nx;
+    const int ny = scene.camera.ny;
+    RenderOptions quality;
+    quality.verbose = false;
+    quality.samples = REFERENCE_SAMPLES;
+    Image ref(nx, ny);
+    double ref_time = raytracing_threaded(scene, ref, quality);
+
+    out << "Sampling against " << REFERENCE_SAMPLES
+        << " samples per pixel (" << ref_time << " s):\n"
+        << "  samples  render s  PSNR dB\n";
+    for (int samples = 1; samples < REFERENCE_SAMPLES; samples *= 2) {
+        Image img(nx, ny);
+        quality.samples = samples;
+        double render_time = raytracing_threaded(scene, img, quality);
+
+        out << std::fixed << std::setprecision(2) << std::setw(9) << samples
+            << std::setw(10) << render_time << std::setw(9)
+            << psnr(img, ref) << "\n";
+        out.unsetf(std::ios::floatfield);
+    }
+    return animation_report(scene, path, out);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <iostream>
+
+// Renders the scene at path several times per thread placement and prints
+// the best time of each, so the placements can be compared on one machine.
+// Then reports the memory and image difference of the compact geometry, and
+// compares renders with few samples per pixel against a render with many
+// samples. Finally animates the vertices and compares refitting with
+// rebuilding the hierarchies.
+bool run_benchmark(const char *path, const int repeats, std::ostream &out);
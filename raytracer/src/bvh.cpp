@@ -0,0 +1,243 @@
+#include "bvh.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+static const int MAX_LEAF_SIZE = 4;
+static const double TRAVERSAL_COST = 1.0;
+static const double INTERSECT_COST = 1.0;
+
+static double surface_area(const AABB &box) {
+    vec3 d = box.m_maxPoint - box.m_minPoint;
+    if (d.x < 0 || d.y < 0 || d.z < 0)
+        return 0;
+    return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+static double axis(const vec3 &v, const int a) {
+    return a == 0 ? v.x : (a == 1 ? v.y : v.z);
+}
+
+static AABB triangle_box(const std::vector<point3> &vertices,
+                         const std::vector<int> &indices, const int tri) {
+    AABB box = AABB::empty();
+    for (int k = 0; k < 3; ++k)
+        box.expand(vertices[indices[3 * tri + k] - 1]);
+    return box;
+}
+
+// Bounds of a leaf from its triangles, or of an inner node from its already
+// refitted children.
+static void refit_node(std::vector<BVHNode> &nodes, const int n,
+                       const std::vector<point3> &vertices,
+                       const std::vector<int> &indices) {
+    BVHNode &node = nodes[n];
+    if (node.count > 0) {
+        node.box = AABB::empty();
+        for (int i = node.first; i < node.first + node.count; ++i)
+            node.box.expand(triangle_box(vertices, indices, i));
+    } else {
+        node.box = nodes[node.first].box;
+        node.box.expand(nodes[node.first + 1].box);
+    }
+}
+
+namespace {
+struct TriangleBounds {
+    const std::vector<point3> &vertices;
+    const std::vector<int> &indices;
+
+    AABB operator()(const int tri) const {
+        return triangle_box(vertices, indices, tri);
+    }
+};
+
+struct BoxBounds {
+    const std::vector<AABB> &boxes;
+
+    AABB operator()(const int i) const {
+        return boxes[i];
+    }
+};
+
+template <class Bounds> struct Builder {
+    const Bounds &bounds;
+    std::vector<int> &order;
+    std::vector<point3> &centroids;
+    std::vector<BVHNode> &nodes;
+
+    void subdivide(const int node, const int begin, const int end) {
+        AABB box = AABB::empty();
+        AABB centroid_box = AABB::empty();
+        for (int i = begin; i < end; ++i) {
+            box.expand(bounds(order[i]));
+            centroid_box.expand(centroids[order[i]]);
+        }
+        nodes[node].box = box;
+
+        if (end - begin <= MAX_LEAF_SIZE) {
+            nodes[node].first = begin;
+            nodes[node].count = end - begin;
+            return;
+        }
+
+        vec3 extent = centroid_box.m_maxPoint - centroid_box.m_minPoint;
+        int a = 0;
+        if (extent.y > axis(extent, a))
+            a = 1;
+        if (extent.z > axis(extent, a))
+            a = 2;
+
+        int mid = begin + (end - begin) / 2;
+        std::nth_element(order.begin() + begin, order.begin() + mid,
+                         order.begin() + end, [&](int l, int r) {
+                             return axis(centroids[l], a) <
+                                    axis(centroids[r], a);
+                         });
+
+        int left = static_cast<int>(nodes.size());
+        nodes.push_back(BVHNode());
+        nodes.push_back(BVHNode());
+        nodes[node].first = left;
+        nodes[node].count = 0;
+
+        subdivide(left, begin, mid);
+        subdivide(left + 1, mid, end);
+    }
+};
+} // namespace
+
+void BVH::build(const std::vector<point3> &vertices,
+                std::vector<int> &indices) {
+    m_nodes.clear();
+    m_buildCost = 0;
+
+    int n_tris = static_cast<int>(indices.size() / 3);
+    if (n_tris == 0)
+        return;
+
+    std::vector<int> order(n_tris);
+    std::vector<point3> centroids(n_tris);
+    for (int i = 0; i < n_tris; ++i) {
+        order[i] = i;
+        centroids[i] = (vertices[indices[3 * i] - 1] +
+                        vertices[indices[3 * i + 1] - 1] +
+                        vertices[indices[3 * i + 2] - 1]) /
+                       3.0;
+    }
+
+    m_nodes.reserve(2 * n_tris);
+    m_nodes.push_back(BVHNode());
+    TriangleBounds bounds{vertices, indices};
+    Builder<TriangleBounds> builder{bounds, order, centroids, m_nodes};
+    builder.subdivide(0, 0, n_tris);
+
+    std::vector<int> reordered(3 * n_tris);
+    for (int i = 0; i < n_tris; ++i)
+        for (int k = 0; k < 3; ++k)
+            reordered[3 * i + k] = indices[3 * order[i] + k];
+    reordered.swap(indices);
+    indices.resize(3 * n_tris);
+
+    m_buildCost = sah_cost();
+}
+
+void BVH::build(const std::vector<AABB> &boxes, std::vector<int> &order) {
+    m_nodes.clear();
+    m_buildCost = 0;
+
+    int n_boxes = static_cast<int>(boxes.size());
+    order.resize(n_boxes);
+    if (n_boxes == 0)
+        return;
+
+    std::vector<point3> centroids(n_boxes);
+    for (int i = 0; i < n_boxes; ++i) {
+        order[i] = i;
+        centroids[i] = (boxes[i].m_minPoint + boxes[i].m_maxPoint) / 2.0;
+    }
+
+    m_nodes.reserve(2 * n_boxes);
+    m_nodes.push_back(BVHNode());
+    BoxBounds bounds{boxes};
+    Builder<BoxBounds> builder{bounds, order, centroids, m_nodes};
+    builder.subdivide(0, 0, n_boxes);
+
+    m_buildCost = sah_cost();
+}
+
+double BVH::refit(const std::vector<point3> &vertices,
+                  const std::vector<int> &indices,
+                  const unsigned int threads) {
+    if (threads <= 1 ||
+        static_cast<int>(m_nodes.size()) < PARALLEL_REFIT_NODES) {
+        for (int n = static_cast<int>(m_nodes.size()) - 1; n >= 0; --n)
+            refit_node(m_nodes, n, vertices, indices);
+    } else {
+        // Expand the tree breadth first until there are enough independent
+        // subtrees to keep every thread busy.
+        std::vector<int> upper;
+        std::vector<int> frontier{0};
+        while (frontier.size() < 8 * threads) {
+            std::vector<int> next;
+            for (int n : frontier) {
+                if (m_nodes[n].count > 0) {
+                    next.push_back(n);
+                } else {
+                    upper.push_back(n);
+                    next.push_back(m_nodes[n].first);
+                    next.push_back(m_nodes[n].first + 1);
+                }
+            }
+            if (next.size() == frontier.size())
+                break;
+            frontier.swap(next);
+        }
+
+        std::atomic<size_t> next{0};
+        auto job = [&]() {
+            for (size_t i = next++; i < frontier.size(); i = next++)
+                refit_subtree(frontier[i], vertices, indices);
+        };
+        std::vector<std::thread> th;
+        for (unsigned int i = 0; i < threads; ++i)
+            th.push_back(std::thread(job));
+        for (auto &t : th)
+            t.join();
+
+        for (auto it = upper.rbegin(); it != upper.rend(); ++it)
+            refit_node(m_nodes, *it, vertices, indices);
+    }
+
+    if (m_buildCost <= 0)
+        return 1;
+    return sah_cost() / m_buildCost;
+}
+
+void BVH::refit_subtree(const int node, const std::vector<point3> &vertices,
+                        const std::vector<int> &indices) {
+    if (m_nodes[node].count == 0) {
+        refit_subtree(m_nodes[node].first, vertices, indices);
+        refit_subtree(m_nodes[node].first + 1, vertices, indices);
+    }
+    refit_node(m_nodes, node, vertices, indices);
+}
+
+double BVH::sah_cost() const {
+    if (m_nodes.empty())
+        return 0;
+
+    double root_area = surface_area(m_nodes[0].box);
+    if (root_area <= 0)
+        return 0;
+
+    double cost = 0;
+    for (auto &node : m_nodes) {
+        double p = surface_area(node.box) / root_area;
+        if (node.count > 0)
+            cost += p * node.count * INTERSECT_COST;
+        else
+            cost += p * TRAVERSAL_COST;
+    }
+    return cost;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "aabb.h"
+#include "vec3.h"
+#include <vector>
+
+struct BVHNode {
+    AABB box;
+    // Inner nodes: index of the left child, the right child follows it.
+    // Leaves: index of the first triangle in the reordered index list.
+    int first;
+    // Number of triangles in a leaf, 0 for inner nodes.
+    int count;
+};
+
+// Bounding volume hierarchy over the triangles of a single mesh. Nodes are
+// stored so that every child comes after its parent, which lets refit()
+// update the bounds bottom-up with a single reverse sweep.
+class BVH {
+  public:
+    // Builds the hierarchy and reorders the triangles of the 1-based index
+    // list so that every leaf covers a contiguous range of them.
+    void build(const std::vector<point3> &vertices, std::vector<int> &indices);
+
+    // Builds the hierarchy over arbitrary boxes, such as the bounds of whole
+    // meshes. Leaves cover contiguous ranges of order, which is filled with
+    // the box indices.
+    void build(const std::vector<AABB> &boxes, std::vector<int> &order);
+
+    // Recomputes the node bounds from the current vertex positions while
+    // keeping the topology. Returns the SAH cost of the refitted tree
+    // relative to the cost it had when it was built. Trees with at least
+    // PARALLEL_REFIT_NODES nodes are split into subtrees that are refitted
+    // on up to the given number of threads before the nodes above them.
+    double refit(const std::vector<point3> &vertices,
+                 const std::vector<int> &indices,
+                 const unsigned int threads = 1);
+
+    static const int PARALLEL_REFIT_NODES = 16384;
+
+    double sah_cost() const;
+
+    bool empty() const {
+        return m_nodes.empty();
+    }
+
+    const std::vector<BVHNode> &nodes() const {
+        return m_nodes;
+    }
+
+  private:
+    void refit_subtree(const int node, const std::vector<point3> &vertices,
+                       const std::vector<int> &indices);
+
+    std::vector<BVHNode> m_nodes;
+    double m_buildCost{0};
+};
@@ -11,10 +11,16 @@ struct Camera {
     int nx, ny;
 
     ray ray_to_pixel(const int i, const int j) const {
+        return ray_to_pixel(i, j, 0.5, 0.5);
+    }
+
+    // Ray through the point (dx, dy) of the pixel, both in [0, 1).
+    ray ray_to_pixel(const int i, const int j, const double dx,
+                     const double dy) const {
         point3 m = position - w * near_dist;
         point3 q = m + np_l * u + np_r * v;
-        double s_u = (i + 0.5) * (np_r - np_l) / nx;
-        double s_v = (j + 0.5) * (np_t - np_b) / ny;
+        double s_u = (i + dx) * (np_r - np_l) / nx;
+        double s_v = (j + dy) * (np_t - np_b) / ny;
         vec3 s = q + s_u * u - s_v * v;
 
         return ray(position, s - position);
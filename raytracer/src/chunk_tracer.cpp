@@ -0,0 +1,122 @@
+#include "chunk_tracer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <utility>
+
+static const double INF = std::numeric_limits<double>::infinity();
+
+ChunkTracer::ChunkTracer(GeometryCache &cache)
+    : m_cache{cache} {
+    for (auto &info : cache.chunks()) {
+        const double *b = info.bounds;
+        m_boxes.push_back(
+            AABB(point3(b[0], b[1], b[2]), point3(b[3], b[4], b[5])));
+    }
+    m_top.build(m_boxes, m_order);
+}
+
+void ChunkTracer::closest_hits(const std::vector<ray> &rays,
+                               const double t_min,
+                               std::vector<HitRecord> &recs,
+                               std::vector<bool> &hits) const {
+    std::vector<double> t_max(rays.size(), INF);
+    recs.resize(rays.size());
+    trace(rays, t_min, t_max, &recs, hits);
+}
+
+void ChunkTracer::occluded(const std::vector<ray> &rays, const double t_min,
+                           const std::vector<double> &t_max,
+                           std::vector<bool> &blocked) const {
+    std::vector<double> limits = t_max;
+    trace(rays, t_min, limits, nullptr, blocked);
+}
+
+void ChunkTracer::trace(const std::vector<ray> &rays, const double t_min,
+                        std::vector<double> &t_max,
+                        std::vector<HitRecord> *recs,
+                        std::vector<bool> &hits) const {
+    hits.assign(rays.size(), false);
+    const std::vector<BVHNode> &nodes = m_top.nodes();
+    if (nodes.empty())
+        return;
+
+    // Queue every ray on the chunks it enters, as (chunk, ray) pairs, and
+    // keep the closest distance at which any ray enters each chunk.
+    std::vector<std::pair<uint32_t, uint32_t>> queued;
+    std::vector<double> nearest(m_boxes.size(), INF);
+    for (uint32_t i = 0; i < rays.size(); ++i) {
+        int stack[64];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const BVHNode &node = nodes[stack[--top]];
+            if (!node.box.hit(rays[i], t_min, t_max[i]))
+                continue;
+
+            if (node.count == 0) {
+                stack[top++] = node.first;
+                stack[top++] = node.first + 1;
+                continue;
+            }
+
+            for (int k = node.first; k < node.first + node.count; ++k) {
+                const int chunk = m_order[k];
+                double t_enter;
+                if (m_boxes[chunk].hit(rays[i], t_min, t_max[i], t_enter)) {
+                    queued.push_back(std::make_pair(chunk, i));
+                    nearest[chunk] = std::min(nearest[chunk], t_enter);
+                }
+            }
+        }
+    }
+
+    // Trace the chunks front to back, so the hits found in near chunks can
+    // spare loading the ones behind them.
+    std::sort(queued.begin(), queued.end(),
+              [&](const std::pair<uint32_t, uint32_t> &a,
+                  const std::pair<uint32_t, uint32_t> &b) {
+                  if (nearest[a.first] != nearest[b.first])
+                      return nearest[a.first] < nearest[b.first];
+                  return a < b;
+              });
+
+    std::vector<uint32_t> hit_chunk(rays.size());
+    std::vector<uint32_t> pending;
+    for (size_t q = 0; q < queued.size();) {
+        const uint32_t chunk = queued[q].first;
+        const AABB &box = m_boxes[chunk];
+
+        // Only acquire the chunk when a ray still reaches its bounds.
+        pending.clear();
+        for (; q < queued.size() && queued[q].first == chunk; ++q) {
+            const uint32_t i = queued[q].second;
+            if ((recs || !hits[i]) && box.hit(rays[i], t_min, t_max[i]))
+                pending.push_back(i);
+        }
+        if (pending.empty())
+            continue;
+
+        std::shared_ptr<const ResidentChunk> resident = m_cache.acquire(chunk);
+        for (uint32_t i : pending) {
+            // Like Scene::hit, a later chunk wins a tie, which happens along
+            // the edges shared with a neighbouring chunk.
+            bool tie = recs && hits[i];
+            double limit = tie ? nextafter(t_max[i], INF) : t_max[i];
+            HitRecord rec;
+            if (!resident->mesh->hit(rays[i], t_min, limit, rec))
+                continue;
+            if (tie && rec.t == t_max[i] && chunk < hit_chunk[i])
+                continue;
+
+            hits[i] = true;
+            if (recs) {
+                t_max[i] = rec.t;
+                hit_chunk[i] = chunk;
+                (*recs)[i] = rec;
+            }
+        }
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "aabb.h"
+#include "bvh.h"
+#include "geometry_cache.h"
+#include "hittable.h"
+#include "ray.h"
+#include <vector>
+
+// Traces batches of rays against the chunks of a GeometryCache. Every ray is
+// queued on the chunks whose bounds it enters, found through a hierarchy over
+// the chunk bounds, and the queues are then traced one chunk at a time, front
+// to back. A chunk is acquired from the cache at most once per batch, and
+// only while a queued ray still reaches its bounds before its closest hit.
+class ChunkTracer {
+  public:
+    explicit ChunkTracer(GeometryCache &cache);
+
+    // Closest hit of every ray beyond t_min, hits[i] is false when rays[i]
+    // misses all chunks.
+    void closest_hits(const std::vector<ray> &rays, const double t_min,
+                      std::vector<HitRecord> &recs,
+                      std::vector<bool> &hits) const;
+
+    // Whether anything lies between t_min and t_max[i] along rays[i].
+    void occluded(const std::vector<ray> &rays, const double t_min,
+                  const std::vector<double> &t_max,
+                  std::vector<bool> &blocked) const;
+
+  private:
+    // Leaves t_max[i] at the closest hit found when recs is set, otherwise
+    // stops tracing a ray at its first hit.
+    void trace(const std::vector<ray> &rays, const double t_min,
+               std::vector<double> &t_max, std::vector<HitRecord> *recs,
+               std::vector<bool> &hits) const;
+
+    GeometryCache &m_cache;
+    std::vector<AABB> m_boxes;
+    BVH m_top;
+    std::vector<int> m_order;
+};
@@ -0,0 +1,206 @@
+#include "compact_mesh.h"
+#include "triangle.h"
+#include <algorithm>
+#include <limits>
+
+static const double INF = std::numeric_limits<double>::infinity();
+static const double QMAX = 65535.0;
+
+static double dequantize(const uint16_t q, const double lo, const double hi) {
+    return lo + (hi - lo) * (q / QMAX);
+}
+
+// Rounds outwards so that the decoded range always contains [lo, hi].
+static void quantize(const double lo, const double hi, const double p_lo,
+                     const double p_hi, uint16_t &q_lo, uint16_t &q_hi) {
+    double extent = p_hi - p_lo;
+    if (extent <= 0) {
+        q_lo = 0;
+        q_hi = 0;
+        return;
+    }
+    double l = floor((lo - p_lo) / extent * QMAX);
+    double h = ceil((hi - p_lo) / extent * QMAX);
+    q_lo = static_cast<uint16_t>(fmax(0.0, fmin(QMAX, l)));
+    q_hi = static_cast<uint16_t>(fmax(0.0, fmin(QMAX, h)));
+    while (q_lo > 0 && dequantize(q_lo, p_lo, p_hi) > lo)
+        --q_lo;
+    while (q_hi < QMAX && dequantize(q_hi, p_lo, p_hi) < hi)
+        ++q_hi;
+}
+
+static AABB decode(const QuantizedNode &node, const AABB &parent) {
+    const point3 &lo = parent.m_minPoint;
+    const point3 &hi = parent.m_maxPoint;
+    return AABB(point3(dequantize(node.qmin[0], lo.x, hi.x),
+                       dequantize(node.qmin[1], lo.y, hi.y),
+                       dequantize(node.qmin[2], lo.z, hi.z)),
+                point3(dequantize(node.qmax[0], lo.x, hi.x),
+                       dequantize(node.qmax[1], lo.y, hi.y),
+                       dequantize(node.qmax[2], lo.z, hi.z)));
+}
+
+static QuantizedNode encode(const AABB &box, const AABB &parent) {
+    QuantizedNode node;
+    const point3 &lo = parent.m_minPoint;
+    const point3 &hi = parent.m_maxPoint;
+    quantize(box.m_minPoint.x, box.m_maxPoint.x, lo.x, hi.x, node.qmin[0],
+             node.qmax[0]);
+    quantize(box.m_minPoint.y, box.m_maxPoint.y, lo.y, hi.y, node.qmin[1],
+             node.qmax[1]);
+    quantize(box.m_minPoint.z, box.m_maxPoint.z, lo.z, hi.z, node.qmin[2],
+             node.qmax[2]);
+    return node;
+}
+
+CompactMesh::CompactMesh(const Mesh &mesh)
+    : mat_id{mesh.material_id()} {
+
+    const std::vector<point3> &vertices = mesh.vertices();
+    const std::vector<int> &indices = mesh.indices();
+    const std::vector<BVHNode> &nodes = mesh.bvh().nodes();
+    if (nodes.empty())
+        return;
+
+    // Only keep the vertices this mesh references, renumbered from 0 in
+    // the order of their scene index.
+    std::vector<int> used(indices);
+    std::sort(used.begin(), used.end());
+    used.erase(std::unique(used.begin(), used.end()), used.end());
+    if (used.size() <= 65536)
+        m_indices16.resize(indices.size());
+    else
+        m_indices32.resize(indices.size());
+    for (size_t j = 0; j < indices.size(); ++j) {
+        size_t i = std::lower_bound(used.begin(), used.end(), indices[j]) -
+                   used.begin();
+        if (m_indices16.empty())
+            m_indices32[j] = static_cast<uint32_t>(i);
+        else
+            m_indices16[j] = static_cast<uint16_t>(i);
+    }
+
+    AABB bounds = AABB::empty();
+    for (int i : used)
+        bounds.expand(vertices[i - 1]);
+    m_origin = bounds.m_minPoint;
+
+    m_vertices.reserve(3 * used.size());
+    for (int i : used) {
+        const vec3 v = vertices[i - 1] - m_origin;
+        m_vertices.push_back(static_cast<float>(v.x));
+        m_vertices.push_back(static_cast<float>(v.y));
+        m_vertices.push_back(static_cast<float>(v.z));
+    }
+
+    std::vector<int>().swap(used);
+
+    // The rounded vertices moved slightly, so bound them again using the
+    // topology of the source BVH before encoding the nodes.
+    std::vector<AABB> exact(nodes.size());
+    for (int n = static_cast<int>(nodes.size()) - 1; n >= 0; --n) {
+        const BVHNode &node = nodes[n];
+        exact[n] = AABB::empty();
+        if (node.count > 0) {
+            for (int j = 3 * node.first; j < 3 * (node.first + node.count);
+                 ++j)
+                exact[n].expand(vertex(index(j)));
+        } else {
+            exact[n].expand(exact[node.first]);
+            exact[n].expand(exact[node.first + 1]);
+        }
+    }
+
+    // Parents precede their children, so the decoded parent bounds are
+    // always known when a node is encoded. The exact bounds of a node are
+    // not needed after it is encoded and get replaced by the decoded ones.
+    m_boundingBox = exact[0];
+    m_nodes.resize(nodes.size());
+    m_nodes[0] = encode(m_boundingBox, m_boundingBox);
+    for (size_t n = 0; n < nodes.size(); ++n) {
+        m_nodes[n].first = nodes[n].first;
+        m_nodes[n].count = nodes[n].count;
+        if (nodes[n].count > 0)
+            continue;
+        for (int c = nodes[n].first; c < nodes[n].first + 2; ++c) {
+            m_nodes[c] = encode(exact[c], exact[n]);
+            exact[c] = decode(m_nodes[c], exact[n]);
+        }
+    }
+}
+
+bool CompactMesh::hit(const ray &r, const double &t_min, const double &t_max,
+                      HitRecord &rec) const {
+
+    if (m_nodes.empty() || !m_boundingBox.hit(r, t_min, t_max))
+        return false;
+
+    rec.t = INF;
+    double t = -1;
+    double closest = t_max;
+    bool ret = false;
+
+    struct Entry {
+        uint32_t node;
+        AABB box;
+    };
+    Entry stack[64];
+    int top = 0;
+    stack[top++] = Entry{0, m_boundingBox};
+
+    while (top > 0) {
+        const Entry e = stack[--top];
+        const QuantizedNode &node = m_nodes[e.node];
+        if (!e.box.hit(r, t_min, closest))
+            continue;
+
+        if (node.count == 0) {
+            stack[top++] =
+                Entry{node.first, decode(m_nodes[node.first], e.box)};
+            stack[top++] =
+                Entry{node.first + 1, decode(m_nodes[node.first + 1], e.box)};
+            continue;
+        }
+
+        for (size_t j = 3 * node.first; j < 3 * (node.first + node.count);
+             j += 3) {
+            point3 v0 = vertex(index(j));
+            point3 v1 = vertex(index(j + 1));
+            point3 v2 = vertex(index(j + 2));
+            if (intersect(v0, v1, v2, r, t_min, closest, t)) {
+                closest = t;
+                rec.t = t;
+                rec.normal = cross(v1 - v0, v2 - v0);
+                rec.mat_id = mat_id;
+                ret = true;
+            }
+        }
+    }
+    return ret;
+}
+
+bool CompactMesh::initBoundingBox() {
+    // The bounds are fixed when the mesh is compressed.
+    return !m_nodes.empty();
+}
+
+Refit CompactMesh::refitBoundingBox(const double, const unsigned int) {
+    // The source vertices are released after compression.
+    return Refit::Unsupported;
+}
+
+size_t CompactMesh::memory_usage() const {
+    return sizeof(CompactMesh) + m_vertices.capacity() * sizeof(float) +
+           m_indices16.capacity() * sizeof(uint16_t) +
+           m_indices32.capacity() * sizeof(uint32_t) +
+           m_nodes.capacity() * sizeof(QuantizedNode);
+}
+
+point3 CompactMesh::vertex(const uint32_t i) const {
+    const float *v = &m_vertices[3 * i];
+    return point3(m_origin.x + v[0], m_origin.y + v[1], m_origin.z + v[2]);
+}
+
+uint32_t CompactMesh::index(const size_t j) const {
+    return m_indices16.empty() ? m_indices32[j] : m_indices16[j];
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "aabb.h"
+#include "hittable.h"
+#include "mesh.h"
+#include "vec3.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// BVH node whose bounds are quantized to 16 bits relative to the decoded
+// bounds of its parent.
+struct QuantizedNode {
+    uint16_t qmin[3], qmax[3];
+    uint32_t first;
+    uint32_t count;
+};
+
+// Read-only copy of a Mesh for large scenes. Vertices are stored as floats
+// relative to the corner of the mesh bounds, which keeps their error below
+// 2^-24 of the mesh extent; 16 bit vertices moved edges far enough to change
+// which faces grazing rays hit. Indices are stored with 16 bits when the mesh
+// references few enough vertices, and the BVH uses QuantizedNode. All of it
+// is decoded on the fly during traversal.
+class CompactMesh : public Hittable {
+  public:
+    explicit CompactMesh(const Mesh &mesh);
+
+    virtual bool hit(const ray &r, const double &t_min, const double &t_max,
+                     HitRecord &rec) const;
+    virtual bool initBoundingBox();
+    virtual const AABB &boundingBox() const {
+        return m_boundingBox;
+    }
+    virtual Refit refitBoundingBox(const double max_cost_ratio,
+                                   const unsigned int threads = 1);
+    virtual size_t memory_usage() const;
+    virtual Hittable *clone(const std::vector<point3> &) const {
+        return new CompactMesh(*this);
+    }
+
+  private:
+    point3 vertex(const uint32_t i) const;
+    uint32_t index(const size_t j) const;
+
+    std::vector<float> m_vertices;
+    std::vector<uint16_t> m_indices16;
+    std::vector<uint32_t> m_indices32;
+    std::vector<QuantizedNode> m_nodes;
+    point3 m_origin;
+    std::string mat_id;
+    AABB m_boundingBox;
+};
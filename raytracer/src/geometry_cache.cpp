@@ -0,0 +1,430 @@
+#include "geometry_cache.h"
+#include "scene_stream.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char MAGIC[8] = {'R', 'T', 'C', 'H', 'U', 'N', 'K', '2'};
+static const size_t HEADER_SIZE = 24;
+
+static size_t align8(const size_t n) {
+    return (n + 7) & ~static_cast<size_t>(7);
+}
+
+static size_t chunk_bytes(const ChunkInfo &info) {
+    return info.vertex_count * 3 * sizeof(double) +
+           align8(info.index_count * sizeof(int32_t));
+}
+
+// Memory a chunk takes once it is loaded, see ResidentChunk::memory_usage().
+static size_t chunk_memory(const ChunkInfo &info) {
+    size_t n_tris = info.index_count / 3;
+    return info.vertex_count * sizeof(point3) + sizeof(Mesh) +
+           3 * n_tris * sizeof(int) + 2 * n_tris * sizeof(BVHNode);
+}
+
+// Renumbers the vertices referenced by the indices [begin, end) of a mesh
+// from 1 and collects them in the order they are first used.
+static void gather_chunk(const Mesh &mesh, const size_t begin,
+                         const size_t end, std::vector<point3> &vertices,
+                         std::vector<int32_t> &indices) {
+    std::unordered_map<int, int32_t> local;
+    vertices.clear();
+    indices.clear();
+    for (size_t j = begin; j < end; ++j) {
+        int i = mesh.indices()[j];
+        auto it = local.find(i);
+        if (it == local.end()) {
+            vertices.push_back(mesh.vertices()[i - 1]);
+            int32_t id = static_cast<int32_t>(vertices.size());
+            it = local.insert({i, id}).first;
+        }
+        indices.push_back(it->second);
+    }
+}
+
+namespace {
+// First pass of bake_chunk_file(), spools the vertices to a file.
+struct VertexSpool : public GeometryVisitor {
+    FILE *file;
+    size_t count{0};
+
+    explicit VertexSpool(FILE *file)
+        : file{file} {
+    }
+
+    virtual bool vertex(const point3 &p) {
+        double xyz[3] = {p.x, p.y, p.z};
+        ++count;
+        return fwrite(xyz, sizeof(xyz), 1, file) == 1;
+    }
+
+    virtual bool mesh(const std::string &, std::vector<int> &) {
+        return true;
+    }
+};
+
+// Second pass of bake_chunk_file(), chunks and writes one mesh at a time.
+struct ChunkWriter : public GeometryVisitor {
+    const double *vertices;
+    size_t vertex_count;
+    std::ofstream &out;
+    size_t step;
+    std::vector<ChunkInfo> table;
+    uint64_t offset{HEADER_SIZE};
+
+    ChunkWriter(const double *vertices, const size_t vertex_count,
+                std::ofstream &out, const int tris_per_chunk)
+        : vertices{vertices}
+        , vertex_count{vertex_count}
+        , out(out)
+        , step{3 * static_cast<size_t>(tris_per_chunk)} {
+    }
+
+    virtual bool vertex(const point3 &) {
+        return true;
+    }
+
+    virtual bool mesh(const std::string &material_id,
+                      std::vector<int> &indices) {
+        if (material_id.size() >= sizeof(ChunkInfo().material_id)) {
+            std::cerr << "Error: Material id " << material_id
+                      << " is too long for a chunk file." << std::endl;
+            return false;
+        }
+
+        // Copy the vertices of this mesh out of the spool, renumbered from 1.
+        std::vector<int> used(indices);
+        std::sort(used.begin(), used.end());
+        used.erase(std::unique(used.begin(), used.end()), used.end());
+        if (!used.empty() && (used.front() < 1 ||
+                              used.back() > static_cast<int>(vertex_count))) {
+            std::cerr << "Error: Mesh with material " << material_id
+                      << " references a missing vertex." << std::endl;
+            return false;
+        }
+        std::vector<point3> local(used.size());
+        for (size_t i = 0; i < used.size(); ++i) {
+            const double *v = vertices + 3 * (used[i] - 1);
+            local[i] = point3(v[0], v[1], v[2]);
+        }
+        for (auto &i : indices)
+            i = std::lower_bound(used.begin(), used.end(), i) - used.begin() +
+                1;
+        std::vector<int>().swap(used);
+
+        // The mesh indices are in BVH leaf order, so consecutive triangles
+        // are close to each other.
+        Mesh mesh(local, indices, material_id);
+        std::vector<int>().swap(indices);
+
+        std::vector<point3> chunk_vertices;
+        std::vector<int32_t> chunk_indices;
+        const char padding[8] = {0};
+        size_t n_indices = mesh.indices().size() / 3 * 3;
+        for (size_t begin = 0; begin < n_indices; begin += step) {
+            gather_chunk(mesh, begin, std::min(begin + step, n_indices),
+                         chunk_vertices, chunk_indices);
+            AABB box = AABB::empty();
+            for (auto &v : chunk_vertices) {
+                box.expand(v);
+                double xyz[3] = {v.x, v.y, v.z};
+                out.write(reinterpret_cast<const char *>(xyz), sizeof(xyz));
+            }
+            size_t index_bytes = chunk_indices.size() * sizeof(int32_t);
+            out.write(reinterpret_cast<const char *>(chunk_indices.data()),
+                      index_bytes);
+            out.write(padding, align8(index_bytes) - index_bytes);
+
+            ChunkInfo info;
+            memset(&info, 0, sizeof(info));
+            info.bounds[0] = box.m_minPoint.x;
+            info.bounds[1] = box.m_minPoint.y;
+            info.bounds[2] = box.m_minPoint.z;
+            info.bounds[3] = box.m_maxPoint.x;
+            info.bounds[4] = box.m_maxPoint.y;
+            info.bounds[5] = box.m_maxPoint.z;
+            info.offset = offset;
+            info.vertex_count = chunk_vertices.size();
+            info.index_count = chunk_indices.size();
+            strcpy(info.material_id, material_id.c_str());
+            table.push_back(info);
+            offset += chunk_bytes(info);
+        }
+        return out.good();
+    }
+};
+} // namespace
+
+bool bake_chunk_file(const char *scene_path, const char *path,
+                     const int tris_per_chunk) {
+    FILE *spool = tmpfile();
+    if (!spool) {
+        std::cerr << "Error: Temporary vertex file cannot be created."
+                  << std::endl;
+        return false;
+    }
+
+    std::string description;
+    VertexSpool spooled{spool};
+    if (!stream_scene_file(scene_path, description, &spooled) ||
+        fflush(spool) != 0) {
+        fclose(spool);
+        return false;
+    }
+
+    size_t spool_size = spooled.count * 3 * sizeof(double);
+    void *data = nullptr;
+    if (spool_size > 0) {
+        data = mmap(nullptr, spool_size, PROT_READ, MAP_PRIVATE,
+                    fileno(spool), 0);
+        if (data == MAP_FAILED) {
+            std::cerr << "Error: Temporary vertex file cannot be mapped."
+                      << std::endl;
+            fclose(spool);
+            return false;
+        }
+    }
+
+    std::ofstream out{path, std::ios::out | std::ios::binary};
+    if (!out.is_open()) {
+        std::cerr << "Error: Chunk file " << path << " cannot be opened."
+                  << std::endl;
+        if (data)
+            munmap(data, spool_size);
+        fclose(spool);
+        return false;
+    }
+
+    // The header is written again once the table is known.
+    const char header[HEADER_SIZE] = {0};
+    out.write(header, sizeof(header));
+    ChunkWriter writer{static_cast<const double *>(data), spooled.count, out,
+                       tris_per_chunk};
+    bool ok = stream_scene_file(scene_path, description, &writer);
+    if (data)
+        munmap(data, spool_size);
+    fclose(spool);
+    if (!ok)
+        return false;
+
+    uint32_t count[2] = {static_cast<uint32_t>(writer.table.size()), 0};
+    uint64_t table_offset = writer.offset;
+    out.write(reinterpret_cast<const char *>(writer.table.data()),
+              writer.table.size() * sizeof(ChunkInfo));
+    out.seekp(0);
+    out.write(MAGIC, sizeof(MAGIC));
+    out.write(reinterpret_cast<const char *>(count), sizeof(count));
+    out.write(reinterpret_cast<const char *>(&table_offset),
+              sizeof(table_offset));
+    return out.good();
+}
+
+GeometryCache::GeometryCache(const size_t budget_bytes)
+    : m_budget{budget_bytes} {
+}
+
+GeometryCache::~GeometryCache() {
+    if (m_data)
+        munmap(const_cast<char *>(m_data), m_size);
+}
+
+bool GeometryCache::open(const char *path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Error: Chunk file " << path << " cannot be opened."
+                  << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(HEADER_SIZE))
+        data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        std::cerr << "Error: Chunk file " << path << " cannot be mapped."
+                  << std::endl;
+        return false;
+    }
+    m_data = static_cast<const char *>(data);
+    m_size = st.st_size;
+
+    uint32_t count;
+    uint64_t table_offset;
+    memcpy(&count, m_data + sizeof(MAGIC), sizeof(count));
+    memcpy(&table_offset, m_data + sizeof(MAGIC) + 2 * sizeof(uint32_t),
+           sizeof(table_offset));
+    if (memcmp(m_data, MAGIC, sizeof(MAGIC)) != 0 || table_offset > m_size ||
+        count > (m_size - table_offset) / sizeof(ChunkInfo)) {
+        std::cerr << "Error: " << path << " is not a chunk file." << std::endl;
+        return false;
+    }
+
+    m_chunks.resize(count);
+    memcpy(m_chunks.data(), m_data + table_offset, count * sizeof(ChunkInfo));
+    for (auto &info : m_chunks) {
+        if (info.offset + chunk_bytes(info) > table_offset) {
+            std::cerr << "Error: Chunk file " << path << " is truncated."
+                      << std::endl;
+            m_chunks.clear();
+            return false;
+        }
+        info.material_id[sizeof(info.material_id) - 1] = '\0';
+        if (chunk_memory(info) > m_budget) {
+            std::cerr << "Error: A chunk of " << path << " takes "
+                      << chunk_memory(info) / (1024.0 * 1024.0)
+                      << " MB, more than the cache budget of "
+                      << m_budget / (1024.0 * 1024.0) << " MB." << std::endl;
+            m_chunks.clear();
+            return false;
+        }
+    }
+    m_loads.assign(count, 0);
+    return true;
+}
+
+namespace {
+struct Release {
+    GeometryCache *cache;
+    uint32_t chunk;
+    void (GeometryCache::*release)(const uint32_t);
+
+    void operator()(const ResidentChunk *) const {
+        (cache->*release)(chunk);
+    }
+};
+} // namespace
+
+std::shared_ptr<const ResidentChunk>
+GeometryCache::acquire(const uint32_t chunk) {
+    std::unique_lock<std::mutex> lock{m_mutex};
+    const size_t bytes = chunk_memory(m_chunks[chunk]);
+    bool waited = false;
+    for (;;) {
+        auto it = m_entries.find(chunk);
+        if (it != m_entries.end()) {
+            ++m_hits;
+            return pin(chunk, it->second);
+        }
+        // Another thread is loading the chunk, or the budget is taken by
+        // chunks that are in use.
+        if (m_loading.count(chunk) == 0 && evict(bytes))
+            break;
+        if (!waited)
+            ++m_waits;
+        waited = true;
+        m_released.wait(lock);
+    }
+
+    // Decode and build the BVH without holding the lock, the budget for it
+    // is reserved.
+    ++m_misses;
+    ++m_loads[chunk];
+    m_loading.insert(chunk);
+    m_resident += bytes;
+    m_peak = std::max(m_peak, m_resident);
+    lock.unlock();
+    std::unique_ptr<const ResidentChunk> loaded = load(chunk);
+    lock.lock();
+
+    m_loading.erase(chunk);
+    m_resident = m_resident - bytes + loaded->memory_usage();
+    m_peak = std::max(m_peak, m_resident);
+    m_lru.push_front(chunk);
+    Entry &entry = m_entries[chunk];
+    entry.chunk = std::move(loaded);
+    entry.lru = m_lru.begin();
+    entry.pins = 0;
+    std::shared_ptr<const ResidentChunk> pinned = pin(chunk, entry);
+    m_released.notify_all();
+    return pinned;
+}
+
+std::shared_ptr<const ResidentChunk> GeometryCache::pin(const uint32_t chunk,
+                                                        Entry &entry) {
+    ++entry.pins;
+    m_lru.splice(m_lru.begin(), m_lru, entry.lru);
+    return std::shared_ptr<const ResidentChunk>(
+        entry.chunk.get(), Release{this, chunk, &GeometryCache::release});
+}
+
+void GeometryCache::release(const uint32_t chunk) {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    --m_entries[chunk].pins;
+    m_released.notify_all();
+}
+
+std::unique_ptr<const ResidentChunk>
+GeometryCache::load(const uint32_t chunk) const {
+    const ChunkInfo &info = m_chunks[chunk];
+    const char *p = m_data + info.offset;
+
+    std::unique_ptr<ResidentChunk> resident{new ResidentChunk()};
+    resident->vertices.reserve(info.vertex_count);
+    for (uint32_t i = 0; i < info.vertex_count; ++i) {
+        double xyz[3];
+        memcpy(xyz, p, sizeof(xyz));
+        p += sizeof(xyz);
+        resident->vertices.push_back(point3(xyz[0], xyz[1], xyz[2]));
+    }
+
+    std::vector<int> indices(info.index_count);
+    memcpy(indices.data(), p, info.index_count * sizeof(int32_t));
+    resident->mesh.reset(
+        new Mesh(resident->vertices, indices, info.material_id));
+    return std::unique_ptr<const ResidentChunk>(resident.release());
+}
+
+// Evicts the least recently used chunks nobody holds until bytes more fit in
+// the budget.
+bool GeometryCache::evict(const size_t bytes) {
+    auto it = m_lru.end();
+    while (m_resident + bytes > m_budget && it != m_lru.begin()) {
+        --it;
+        Entry &entry = m_entries[*it];
+        if (entry.pins > 0)
+            continue;
+
+        uint32_t chunk = *it;
+        m_resident -= entry.chunk->memory_usage();
+        it = m_lru.erase(it);
+        m_entries.erase(chunk);
+        ++m_evictions;
+
+        // Let the kernel drop the mapped file pages of the chunk as well.
+        const ChunkInfo &info = m_chunks[chunk];
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t begin = (info.offset + page - 1) / page * page;
+        size_t end = (info.offset + chunk_bytes(info)) / page * page;
+        if (end > begin)
+            madvise(const_cast<char *>(m_data) + begin, end - begin,
+                    MADV_DONTNEED);
+    }
+    return m_resident + bytes <= m_budget;
+}
+
+void GeometryCache::print_stats(std::ostream &out) const {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    unsigned int reloaded = 0, most = 0;
+    for (unsigned int loads : m_loads) {
+        if (loads > 1)
+            ++reloaded;
+        most = std::max(most, loads);
+    }
+    out << "Geometry cache: " << m_chunks.size() << " chunks, " << m_hits
+        << " hits, " << m_misses << " misses, " << m_evictions
+        << " evictions, " << m_waits << " waits for a free budget, peak "
+        << "resident " << m_peak / (1024.0 * 1024.0) << " MB of "
+        << m_budget / (1024.0 * 1024.0) << " MB\n";
+    if (reloaded > 0)
+        out << "Warning: " << reloaded << " chunks were loaded more than "
+            << "once, up to " << most << " times. The cache budget is below "
+            << "the working set.\n";
+}
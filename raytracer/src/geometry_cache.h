@@ -0,0 +1,96 @@
+#pragma once
+
+#include "mesh.h"
+#include "vec3.h"
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// A chunk file starts with a magic string, the number of chunks and the
+// offset of the ChunkInfo table at its end. The packed data of every chunk
+// precedes the table: its vertices as doubles and its 1-based int indices
+// into those vertices.
+struct ChunkInfo {
+    double bounds[6];
+    uint64_t offset;
+    uint32_t vertex_count;
+    uint32_t index_count;
+    char material_id[32];
+};
+
+// Splits every mesh of the scene file at scene_path into chunks of at most
+// tris_per_chunk spatially neighbouring triangles and writes them to path.
+// The scene file is streamed twice: first its vertices go to a temporary
+// file that is memory mapped, then every mesh is chunked and written on its
+// own. Only the largest mesh with its BVH has to fit in memory.
+bool bake_chunk_file(const char *scene_path, const char *path,
+                     const int tris_per_chunk);
+
+struct ResidentChunk {
+    std::vector<point3> vertices;
+    std::unique_ptr<Mesh> mesh;
+
+    size_t memory_usage() const {
+        return vertices.capacity() * sizeof(point3) + mesh->memory_usage();
+    }
+};
+
+// Memory maps a chunk file and keeps the most recently used chunks decoded in
+// memory. The budget is a hard limit on the decoded chunks, including the
+// ones render threads hold: a load first evicts the least recently used
+// chunks nobody holds and otherwise waits until enough are released. Chunk
+// files with a chunk larger than the whole budget are rejected.
+class GeometryCache {
+  public:
+    explicit GeometryCache(const size_t budget_bytes);
+    ~GeometryCache();
+
+    bool open(const char *path);
+
+    // The chunk stays resident until the returned pointer is released. A
+    // thread must release its chunk before it acquires the next one, or the
+    // cache may wait for it forever.
+    std::shared_ptr<const ResidentChunk> acquire(const uint32_t chunk);
+    void print_stats(std::ostream &out) const;
+
+    const std::vector<ChunkInfo> &chunks() const {
+        return m_chunks;
+    }
+
+  private:
+    typedef std::list<uint32_t> LruList;
+    struct Entry {
+        std::unique_ptr<const ResidentChunk> chunk;
+        LruList::iterator lru;
+        // Number of threads holding the chunk.
+        int pins;
+    };
+
+    std::shared_ptr<const ResidentChunk> pin(const uint32_t chunk,
+                                             Entry &entry);
+    void release(const uint32_t chunk);
+    std::unique_ptr<const ResidentChunk> load(const uint32_t chunk) const;
+    bool evict(const size_t bytes);
+
+    size_t m_budget;
+    size_t m_resident{0};
+    size_t m_peak{0};
+    size_t m_hits{0}, m_misses{0}, m_evictions{0}, m_waits{0};
+
+    const char *m_data{nullptr};
+    size_t m_size{0};
+    std::vector<ChunkInfo> m_chunks;
+    std::vector<unsigned int> m_loads;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_released;
+    std::unordered_map<uint32_t, Entry> m_entries;
+    std::unordered_set<uint32_t> m_loading;
+    LruList m_lru;
+};
@@ -1,8 +1,10 @@
 #pragma once
 
+#include "aabb.h"
 #include "ray.h"
 #include "vec3.h"
 #include <string>
+#include <vector>
 
 struct HitRecord {
     double t;
@@ -10,10 +12,30 @@ struct HitRecord {
     std::string mat_id;
 };
 
+enum class Refit { Refitted, Rebuilt, Unsupported };
+
 class Hittable {
   public:
+    virtual ~Hittable() = default;
+
     virtual bool hit(const ray &r, const double &t_min, const double &t_max,
                      HitRecord &rec) const = 0;
 
     virtual bool initBoundingBox() = 0;
+    virtual const AABB &boundingBox() const = 0;
+
+    // Updates the bounds after the underlying vertices moved, using up to the
+    // given number of threads. Falls back to initBoundingBox() when the
+    // refitted bounds are more than max_cost_ratio times worse than freshly
+    // built ones.
+    virtual Refit refitBoundingBox(const double max_cost_ratio,
+                                   const unsigned int threads = 1) = 0;
+
+    // Bytes of geometry and acceleration data owned by this object.
+    virtual size_t memory_usage() const = 0;
+
+    // Deep copy made by the calling thread, so that its memory is placed on
+    // that thread's NUMA node. Meshes indexing into a shared vertex array use
+    // the given one instead.
+    virtual Hittable *clone(const std::vector<point3> &vertices) const = 0;
 };
\ No newline at end of file
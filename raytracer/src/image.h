@@ -10,6 +10,13 @@ class Image {
     color get_pixel(const int i, const int j) const;
     void export_ppm(std::ostream &out) const;
 
+    int width() const {
+        return m_width;
+    }
+    int height() const {
+        return m_height;
+    }
+
   private:
     int m_width, m_height;
     color *data;
@@ -2,103 +2,80 @@
 #include "vec3.h"
 #include <limits>
 #include "aabb.h"
+#include "triangle.h"
 
-static const double EPSILON = 0.000001;
 static const double INF = std::numeric_limits<double>::infinity();
 
-static bool intersect(const point3 &v0, const point3 &v1, const point3 &v2,
-                      const ray &r, const double &t_min, const double &t_max,
-                      double &t);
-
-static inline double determinant(const vec3 &col1, const vec3 &col2,
-                                 const vec3 &col3);
-
 bool Mesh::hit(const ray &r, const double &t_min, const double &t_max,
                HitRecord &rec) const {
 
-    if (!m_boundingBox.hit(r, t_min, t_max))
+    if (m_bvh.empty() || !m_boundingBox.hit(r, t_min, t_max))
         return false;
 
     rec.t = INF;
     double t = -1;
+    double closest = t_max;
     bool ret = false;
 
-    for (size_t j = 0; j < m_indices.size() - 2; j += 3) {
-        int i0 = m_indices[j] - 1;
-        int i1 = m_indices[j + 1] - 1;
-        int i2 = m_indices[j + 2] - 1;
-        if (intersect(m_vertices[i0], m_vertices[i1], m_vertices[i2], r, t_min,
-                      t_max, t) &&
-            rec.t > t) {
-            rec.t = t;
-            rec.normal = cross(m_vertices[i1] - m_vertices[i0],
-                               m_vertices[i2] - m_vertices[i0]);
-            rec.mat_id = mat_id;
-            ret = true;
+    const std::vector<BVHNode> &nodes = m_bvh.nodes();
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        const BVHNode &node = nodes[stack[--top]];
+        if (!node.box.hit(r, t_min, closest))
+            continue;
+
+        if (node.count == 0) {
+            stack[top++] = node.first;
+            stack[top++] = node.first + 1;
+            continue;
+        }
+
+        for (int j = 3 * node.first; j < 3 * (node.first + node.count);
+             j += 3) {
+            int i0 = m_indices[j] - 1;
+            int i1 = m_indices[j + 1] - 1;
+            int i2 = m_indices[j + 2] - 1;
+            if (intersect(m_vertices[i0], m_vertices[i1], m_vertices[i2], r,
+                          t_min, closest, t)) {
+                closest = t;
+                rec.t = t;
+                rec.normal = cross(m_vertices[i1] - m_vertices[i0],
+                                   m_vertices[i2] - m_vertices[i0]);
+                rec.mat_id = mat_id;
+                ret = true;
+            }
         }
     }
     return ret;
 }
 
 bool Mesh::initBoundingBox() {
-    if (m_indices.size() <= 0)
+    if (m_indices.size() < 3)
         return false;
 
-    point3 min = m_vertices[0];
-    point3 max = m_vertices[0];
-
-    for (int ind : m_indices) {
-        auto &vert = m_vertices[ind];
-        if (min.x > vert.x)
-            min.x = vert.x;
-        if (min.y > vert.y)
-            min.y = vert.y;
-        if (min.z > vert.z)
-            min.z = vert.z;
-
-        if (max.x < vert.x)
-            max.x = vert.x;
-        if (max.y < vert.y)
-            max.y = vert.y;
-        if (max.z < vert.z)
-            max.z = vert.z;
-    }
-
-    m_boundingBox.m_minPoint = min;
-    m_boundingBox.m_maxPoint = max;
+    m_bvh.build(m_vertices, m_indices);
+    m_boundingBox = m_bvh.nodes()[0].box;
 
     return true;
 }
 
-static bool intersect(const point3 &v0, const point3 &v1, const point3 &v2,
-                      const ray &r, const double &t_min, const double &t_max,
-                      double &t) {
-
-    vec3 a_b = v0 - v1;
-    vec3 a_c = v0 - v2;
-    double detA = determinant(a_b, a_c, r.direction());
-    if (detA > -EPSILON && detA < EPSILON)
-        return false;
-
-    vec3 a_o = v0 - r.origin();
-    double inv_detA = 1.0 / detA;
-
-    double beta = determinant(a_o, a_c, r.direction()) * inv_detA;
-    if (beta < 0.0 || beta > 1.0)
-        return false;
-
-    double gamma = determinant(a_b, a_o, r.direction()) * inv_detA;
-    if (gamma < 0.0 || beta + gamma > 1.0)
-        return false;
-
-    t = determinant(a_b, a_c, a_o) * inv_detA;
+Refit Mesh::refitBoundingBox(const double max_cost_ratio,
+                             const unsigned int threads) {
+    if (m_bvh.empty() ||
+        m_bvh.refit(m_vertices, m_indices, threads) > max_cost_ratio) {
+        initBoundingBox();
+        return Refit::Rebuilt;
+    }
 
-    return t > t_min && t < t_max;
+    m_boundingBox = m_bvh.nodes()[0].box;
+    return Refit::Refitted;
 }
 
-static inline double determinant(const vec3 &col1, const vec3 &col2,
-                                 const vec3 &col3) {
-    return col1.x * (col2.y * col3.z - col3.y * col2.z) +
-           col1.y * (col3.x * col2.z - col3.z * col2.x) +
-           col1.z * (col2.x * col3.y - col2.y * col3.x);
-}
\ No newline at end of file
+size_t Mesh::memory_usage() const {
+    // The vertices are shared through Scene::vertices and counted there.
+    return sizeof(Mesh) + m_indices.capacity() * sizeof(int) +
+           m_bvh.nodes().capacity() * sizeof(BVHNode);
+}
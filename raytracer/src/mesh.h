@@ -5,6 +5,7 @@
 #include "vec3.h"
 #include <string>
 #include "aabb.h"
+#include "bvh.h"
 #include <iostream>
 
 class Mesh : public Hittable {
@@ -16,13 +17,43 @@ class Mesh : public Hittable {
         , mat_id{material_id} {
         initBoundingBox();
     };
+    Mesh(const Mesh &other, const std::vector<point3> &vertices)
+        : m_vertices{vertices}
+        , m_indices{other.m_indices}
+        , mat_id{other.mat_id}
+        , m_boundingBox{other.m_boundingBox}
+        , m_bvh{other.m_bvh} {
+    }
     virtual bool hit(const ray &r, const double &t_min, const double &t_max,
                      HitRecord &rec) const;
     virtual bool initBoundingBox();
+    virtual const AABB &boundingBox() const {
+        return m_boundingBox;
+    }
+    virtual Refit refitBoundingBox(const double max_cost_ratio,
+                                   const unsigned int threads = 1);
+    virtual size_t memory_usage() const;
+    virtual Hittable *clone(const std::vector<point3> &vertices) const {
+        return new Mesh(*this, vertices);
+    }
+
+    const std::vector<point3> &vertices() const {
+        return m_vertices;
+    }
+    const std::vector<int> &indices() const {
+        return m_indices;
+    }
+    const std::string &material_id() const {
+        return mat_id;
+    }
+    const BVH &bvh() const {
+        return m_bvh;
+    }
 
   private:
     const std::vector<point3> &m_vertices;
     std::vector<int> m_indices;
     std::string mat_id;
     AABB m_boundingBox;
+    BVH m_bvh;
 };
\ No newline at end of file
@@ -0,0 +1,114 @@
+#include "numa.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Parses lists such as "0-3,8-11" used by /sys.
+static std::vector<int> parse_cpulist(const std::string &str) {
+    std::vector<int> cpus;
+    std::stringstream ss{str};
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        std::stringstream rs{range};
+        int first, last;
+        char dash;
+        if (!(rs >> first))
+            continue;
+        last = first;
+        if (rs >> dash >> last && dash != '-')
+            last = first;
+        for (int cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+std::vector<int> available_cpus() {
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set))
+                cpus.push_back(cpu);
+        }
+    }
+#endif
+    if (cpus.empty()) {
+        unsigned int n = std::thread::hardware_concurrency();
+        for (unsigned int cpu = 0; cpu < (n ? n : 1); ++cpu)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+std::vector<NumaNode> numa_topology() {
+    const std::vector<int> available = available_cpus();
+    std::vector<NumaNode> nodes;
+#ifdef __linux__
+    std::ifstream online{"/sys/devices/system/node/online"};
+    std::string list;
+    if (online >> list) {
+        for (int id : parse_cpulist(list)) {
+            std::ifstream in{"/sys/devices/system/node/node" +
+                             std::to_string(id) + "/cpulist"};
+            std::string cpulist;
+            NumaNode node{id, {}};
+            if (in >> cpulist) {
+                for (int cpu : parse_cpulist(cpulist)) {
+                    if (std::binary_search(available.begin(),
+                                           available.end(), cpu))
+                        node.cpus.push_back(cpu);
+                }
+            }
+            if (!node.cpus.empty())
+                nodes.push_back(node);
+        }
+    }
+#endif
+    if (nodes.empty())
+        nodes.push_back(NumaNode{0, available});
+    return nodes;
+}
+
+bool pin_current_thread(const std::vector<int> &cpus) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+        CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+bool interleave_allocations(const std::vector<NumaNode> &nodes) {
+#ifdef __linux__
+    if (nodes.empty())
+        return syscall(SYS_set_mempolicy, MPOL_DEFAULT, nullptr, 0) == 0;
+
+    unsigned long mask = 0;
+    for (auto &node : nodes) {
+        if (node.id < static_cast<int>(8 * sizeof(mask)))
+            mask |= 1UL << node.id;
+    }
+    return syscall(SYS_set_mempolicy, MPOL_INTERLEAVE, &mask,
+                   8 * sizeof(mask)) == 0;
+#else
+    (void)nodes;
+    return false;
+#endif
+}
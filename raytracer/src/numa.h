@@ -0,0 +1,25 @@
+#pragma once
+
+#include <vector>
+
+struct NumaNode {
+    int id;
+    std::vector<int> cpus;
+};
+
+// The cpus the process may run on according to its affinity mask, or every
+// cpu when the mask cannot be read.
+std::vector<int> available_cpus();
+
+// Nodes as listed in /sys on Linux, each holding only its cpus the process
+// may run on. Nodes without such a cpu are left out. Elsewhere, or when the
+// topology cannot be read, a single node holding every available cpu.
+std::vector<NumaNode> numa_topology();
+
+// Restricts the calling thread to the given cpus.
+bool pin_current_thread(const std::vector<int> &cpus);
+
+// Spreads the pages the calling thread allocates from now on round robin
+// over the given nodes, or restores the default local allocation when the
+// list is empty.
+bool interleave_allocations(const std::vector<NumaNode> &nodes);
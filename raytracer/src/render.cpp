@@ -0,0 +1,348 @@
+#include "render.h"
+#include "chunk_tracer.h"
+#include "numa.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#define EPS 0.0000001
+#define INF numeric_limits<double>::infinity()
+static const int MAX_DEPTH = 6;
+static double max(const double a, const double b) {
+    return a > b ? a : b;
+}
+
+// Ray from the surface point x towards the light, dist is set to the
+// distance of the light.
+static ray shadow_ray(const point3 &x, const Pointlight &l, double &dist) {
+    vec3 l_to_x = l.position - x;
+    vec3 w_i = unit_vec(l_to_x);
+    dist = l_to_x.len();
+    return ray(x + EPS * w_i, w_i);
+}
+
+// Adds the diffuse and specular light of l at x to c, for a light that is
+// not shadowed along s.
+static void add_direct_light(const Scene &scene, const Material &mat,
+                             const Pointlight &l, const point3 &x,
+                             const vec3 &n, const ray &s, const double dist,
+                             color &c) {
+    vec3 w_i = s.direction();
+    color E_i = l.intensity / (dist * dist);
+    double cos_t = max(0, dot(n, w_i));
+
+    c += mat.diffuse * cos_t * E_i;
+
+    vec3 w_o = unit_vec(scene.camera.position - x);
+    vec3 h = unit_vec(w_i + w_o);
+
+    double cos_a = max(0, dot(n, h));
+
+    c += mat.specular * pow(cos_a, mat.phong_exp) * E_i;
+}
+
+static ray mirror_ray(const Scene &scene, const point3 &x, const vec3 &n) {
+    vec3 w_o = unit_vec(scene.camera.position - x);
+    vec3 w_r = -w_o + 2 * n * dot(n, w_o);
+    return ray(x + w_r * EPS, w_r);
+}
+
+color ray_color(const Scene &scene, const ray &r, const int depth) {
+    HitRecord closest_hit;
+
+    if (scene.hit(r, 0, INF, closest_hit)) {
+        color c = scene.background;
+        vec3 n = unit_vec(closest_hit.normal);
+        point3 x = r.at(closest_hit.t);
+        Material mat = scene.get_material(closest_hit.mat_id);
+
+        c = mat.ambient * scene.ambient;
+
+        for (auto &l : scene.lights) {
+            double dist_l;
+            ray s = shadow_ray(x, l, dist_l);
+
+            HitRecord shadow_rec;
+            bool shadow = false;
+            for (auto &o : scene.hittables) {
+                if (o->hit(s, 0, INF, shadow_rec)) {
+                    double dist_obj = (s.at(shadow_rec.t) - s.origin()).len();
+                    if (dist_obj < dist_l) {
+                        shadow = true;
+                        break;
+                    }
+                }
+            }
+
+            if (!shadow)
+                add_direct_light(scene, mat, l, x, n, s, dist_l, c);
+        }
+        if (mat.mirror_refl.len() > 0 && depth > 0) {
+            c += mat.mirror_refl *
+                 ray_color(scene, mirror_ray(scene, x, n), depth - 1);
+        }
+        return c;
+    }
+
+    return scene.background;
+}
+
+// Appends the camera rays of every sample of pixel p. The jitter is seeded
+// per pixel so the image does not depend on the scheduling.
+static void camera_rays(const Scene &scene, const int p, const int samples,
+                        vector<ray> &rays) {
+    const int nx = scene.camera.nx;
+    minstd_rand rng(p + 1);
+    uniform_real_distribution<double> jitter(0, 1);
+    for (int s = 0; s < samples; ++s) {
+        double dx = 0.5, dy = 0.5;
+        if (samples > 1) {
+            dx = jitter(rng);
+            dy = jitter(rng);
+        }
+        rays.push_back(scene.camera.ray_to_pixel(p % nx, p / nx, dx, dy));
+    }
+}
+
+// Stores the sums of all samples of pixel p.
+static void store_pixel(const Scene &scene, Image &img, const int p,
+                        const color &c, const RenderOptions &options) {
+    const int nx = scene.camera.nx;
+    img.set_pixel(p % nx, p / nx, c / options.samples);
+}
+
+namespace {
+// Rays of one bounce of render_pixels_streamed().
+struct Bounce {
+    vector<ray> rays;
+    // Index of the ray in the previous bounce that spawned each ray.
+    vector<int> parent;
+    // Color each ray sees, without the reflections of later bounces yet.
+    vector<color> value;
+    vector<color> mirror;
+};
+} // namespace
+
+// Same shading as ray_color(), but every bounce of all pixels is traced as
+// one batch of closest hit rays followed by one batch of shadow rays, so the
+// ChunkTracer can queue them per chunk. The reflections are added back to
+// front afterwards, in the same order as the recursion.
+static void render_pixels_streamed(const Scene &scene,
+                                   const ChunkTracer &tracer, Image &img,
+                                   const vector<int> &pixels,
+                                   const RenderOptions &options) {
+    vector<Bounce> bounces(1);
+    for (int p : pixels)
+        camera_rays(scene, p, options.samples, bounces[0].rays);
+
+    vector<HitRecord> recs;
+    vector<bool> hits, blocked;
+    vector<Material> mats;
+    vector<point3> points;
+    vector<vec3> normals;
+    vector<ray> shadows;
+    vector<double> dists;
+    for (int depth = MAX_DEPTH; !bounces.back().rays.empty(); --depth) {
+        Bounce next;
+        Bounce &b = bounces.back();
+        const size_t n = b.rays.size();
+        tracer.closest_hits(b.rays, 0, recs, hits);
+
+        b.value.assign(n, scene.background);
+        b.mirror.assign(n, color());
+        mats.resize(n);
+        points.resize(n);
+        normals.resize(n);
+        shadows.clear();
+        dists.clear();
+        for (size_t i = 0; i < n; ++i) {
+            if (!hits[i])
+                continue;
+
+            normals[i] = unit_vec(recs[i].normal);
+            points[i] = b.rays[i].at(recs[i].t);
+            mats[i] = scene.get_material(recs[i].mat_id);
+
+            b.value[i] = mats[i].ambient * scene.ambient;
+            for (auto &l : scene.lights) {
+                double dist_l;
+                shadows.push_back(shadow_ray(points[i], l, dist_l));
+                dists.push_back(dist_l);
+            }
+
+            if (mats[i].mirror_refl.len() > 0 && depth > 0) {
+                b.mirror[i] = mats[i].mirror_refl;
+                next.rays.push_back(mirror_ray(scene, points[i], normals[i]));
+                next.parent.push_back(i);
+            }
+        }
+
+        // Every hit queued one shadow ray per light, in order.
+        tracer.occluded(shadows, 0, dists, blocked);
+        for (size_t i = 0, j = 0; i < n; ++i) {
+            if (!hits[i])
+                continue;
+            for (auto &l : scene.lights) {
+                if (!blocked[j])
+                    add_direct_light(scene, mats[i], l, points[i],
+                                     normals[i], shadows[j], dists[j],
+                                     b.value[i]);
+                ++j;
+            }
+        }
+
+        bounces.push_back(next);
+    }
+
+    for (size_t d = bounces.size() - 1; d > 0; --d) {
+        Bounce &parent = bounces[d - 1];
+        for (size_t i = 0; i < bounces[d].rays.size(); ++i) {
+            int p = bounces[d].parent[i];
+            parent.value[p] += parent.mirror[p] * bounces[d].value[i];
+        }
+    }
+
+    for (size_t k = 0; k < pixels.size(); ++k) {
+        color c;
+        for (int s = 0; s < options.samples; ++s)
+            c += bounces[0].value[k * options.samples + s];
+        store_pixel(scene, img, pixels[k], c, options);
+    }
+}
+
+static void render_tile(const Scene &scene, Image &img, const int tile,
+                        const RenderOptions &options) {
+    const int nx = scene.camera.nx;
+    const int ny = scene.camera.ny;
+    const int size = options.tile_size;
+    const int tiles_x = (nx + size - 1) / size;
+    const int x0 = (tile % tiles_x) * size;
+    const int y0 = (tile / tiles_x) * size;
+    const int x1 = std::min(x0 + size, nx);
+    const int y1 = std::min(y0 + size, ny);
+
+    vector<int> pixels;
+    for (int j = y0; j < y1; ++j)
+        for (int i = x0; i < x1; ++i)
+            pixels.push_back(j * nx + i);
+
+    if (options.chunks) {
+        render_pixels_streamed(scene, *options.chunks, img, pixels, options);
+        return;
+    }
+
+    vector<ray> rays;
+    for (int p : pixels) {
+        rays.clear();
+        camera_rays(scene, p, options.samples, rays);
+
+        color c;
+        for (auto &r : rays)
+            c += ray_color(scene, r, MAX_DEPTH);
+        store_pixel(scene, img, p, c, options);
+    }
+}
+
+namespace {
+struct TileQueue {
+    int end = 0;
+    atomic<int> next{0};
+};
+} // namespace
+
+double raytracing_threaded(const Scene &scene, Image &img,
+                           const RenderOptions &options) {
+    // Without any placement, all threads share a single queue and run
+    // wherever the scheduler puts them.
+    vector<NumaNode> nodes;
+    unsigned int unplaced_threads = 0;
+    if (options.pin_threads || options.replicate_scene) {
+        nodes = numa_topology();
+    } else {
+        nodes.push_back(NumaNode{0, vector<int>()});
+        unplaced_threads = available_cpus().size();
+    }
+
+    // A failed pin leaves the thread running anywhere, which still renders
+    // correctly but loses the placement, so it is only reported once.
+    atomic<bool> unpinned{false};
+    auto pin = [&](const vector<int> &cpus) {
+        if (!pin_current_thread(cpus))
+            unpinned = true;
+    };
+
+    vector<Scene> replicas;
+    if (options.replicate_scene) {
+        replicas.resize(nodes.size());
+        vector<thread> th;
+        for (size_t n = 0; n < nodes.size(); ++n) {
+            th.push_back(thread([&, n]() {
+                pin(nodes[n].cpus);
+                scene.replicate(replicas[n]);
+            }));
+        }
+        for (auto &t : th)
+            t.join();
+    }
+
+    const int size = options.tile_size;
+    const int n_tiles = ((scene.camera.nx + size - 1) / size) *
+                        ((scene.camera.ny + size - 1) / size);
+    vector<TileQueue> queues(nodes.size());
+    for (size_t n = 0; n < nodes.size(); ++n) {
+        queues[n].next = n_tiles * n / nodes.size();
+        queues[n].end = n_tiles * (n + 1) / nodes.size();
+    }
+
+    // A thread working on a scene replica has to stay on the node the
+    // replica was allocated on, even when it is not pinned to one cpu.
+    auto job = [&](const size_t node, const int cpu) {
+        if (options.pin_threads)
+            pin(vector<int>{cpu});
+        else if (options.replicate_scene)
+            pin(nodes[node].cpus);
+        const Scene &local =
+            options.replicate_scene ? replicas[node] : scene;
+
+        for (size_t q = 0; q < queues.size(); ++q) {
+            TileQueue &queue = queues[(node + q) % queues.size()];
+            for (int t = queue.next++; t < queue.end; t = queue.next++)
+                render_tile(local, img, t, options);
+        }
+    };
+
+    auto start = chrono::high_resolution_clock::now();
+    vector<thread> th;
+    for (unsigned int i = 0; i < unplaced_threads; ++i)
+        th.push_back(thread(job, 0, -1));
+    for (size_t n = 0; n < nodes.size(); ++n) {
+        for (int cpu : nodes[n].cpus)
+            th.push_back(thread(job, n, cpu));
+    }
+    for (auto &t : th)
+        t.join();
+    auto duration = chrono::duration_cast<chrono::milliseconds>(
+        chrono::high_resolution_clock::now() - start);
+    double seconds = duration.count() / 1000.0;
+    if (unpinned)
+        cerr << "Warning: Some threads could not be pinned to their cpus and "
+                "ran unplaced."
+             << endl;
+
+    if (options.verbose)
+        cout << "Rendering is completed in " << seconds << " seconds with "
+             << th.size() << " threads on " << nodes.size()
+             << " NUMA node(s).\n";
+
+    for (auto &replica : replicas) {
+        for (auto o : replica.hittables)
+            delete o;
+    }
+    return seconds;
+}
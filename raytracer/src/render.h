@@ -0,0 +1,30 @@
+#pragma once
+
+#include "image.h"
+#include "ray.h"
+#include "scene.h"
+
+class ChunkTracer;
+
+struct RenderOptions {
+    int tile_size = 32;
+    // Samples per pixel. A single sample goes through the pixel center, more
+    // are jittered inside the pixel.
+    int samples = 1;
+    // Traces the chunks of a streamed scene instead of its hittables.
+    const ChunkTracer *chunks = nullptr;
+    // Pin every worker thread to one cpu, grouped by NUMA node.
+    bool pin_threads = false;
+    // Give every NUMA node its own copy of the scene, made by a thread
+    // running on that node. The threads using a copy are kept on its node.
+    bool replicate_scene = false;
+    bool verbose = true;
+};
+
+color ray_color(const Scene &scene, const ray &r, const int depth);
+
+// Renders the scene into img and returns the rendering time in seconds. The
+// image is split into tiles and every NUMA node first works through its own
+// share of them before helping the others.
+double raytracing_threaded(const Scene &scene, Image &img,
+                           const RenderOptions &options);
@@ -1,4 +1,8 @@
 #include "scene.h"
+#include "mesh.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 Material Scene::get_material(std::string id) const {
     for (auto &mat : materials) {
@@ -23,4 +27,68 @@ bool Scene::hit(const ray &r, const double t_min, const double t_max,
     }
 
     return is_hit;
+}
+
+bool Scene::update_vertices(const std::vector<point3> &positions,
+                            const double max_cost_ratio, size_t *rebuilt) {
+    if (positions.size() != vertices.size())
+        return false;
+
+    std::copy(positions.begin(), positions.end(), vertices.begin());
+
+    unsigned int nThreads = std::thread::hardware_concurrency();
+    if (nThreads == 0)
+        nThreads = 1;
+
+    std::vector<Hittable *> large, small;
+    for (auto o : hittables) {
+        const Mesh *mesh = dynamic_cast<const Mesh *>(o);
+        if (mesh && static_cast<int>(mesh->bvh().nodes().size()) >=
+                        BVH::PARALLEL_REFIT_NODES)
+            large.push_back(o);
+        else
+            small.push_back(o);
+    }
+
+    std::atomic<size_t> n_rebuilt{0};
+    std::atomic<bool> ok{true};
+    auto refit = [&](Hittable *o, const unsigned int threads) {
+        Refit result = o->refitBoundingBox(max_cost_ratio, threads);
+        if (result == Refit::Rebuilt)
+            ++n_rebuilt;
+        else if (result == Refit::Unsupported)
+            ok = false;
+    };
+
+    for (auto o : large)
+        refit(o, nThreads);
+
+    std::atomic<size_t> next{0};
+    auto job = [&]() {
+        for (size_t i = next++; i < small.size(); i = next++)
+            refit(small[i], 1);
+    };
+
+    std::vector<std::thread> th;
+    for (unsigned int i = 0; i < nThreads && i < small.size(); ++i)
+        th.push_back(std::thread(job));
+    for (auto &t : th)
+        t.join();
+
+    if (rebuilt)
+        *rebuilt = n_rebuilt;
+    return ok;
+}
+
+size_t Scene::memory_usage() const {
+    size_t bytes = vertices.capacity() * sizeof(point3);
+    for (auto &o : hittables)
+        bytes += o->memory_usage();
+    return bytes;
+}
+
+void Scene::replicate(Scene &replica) const {
+    replica = *this;
+    for (auto &o : replica.hittables)
+        o = o->clone(replica.vertices);
 }
\ No newline at end of file
@@ -28,5 +28,37 @@ struct Scene {
     Material get_material(std::string id) const;
     bool hit(const ray &r, const double t_min, const double t_max,
              HitRecord &rec) const;
+
+    // Replaces the vertex positions of an animated frame in place and refits
+    // the bounds of every hittable in parallel: large meshes one after the
+    // other with all threads, the rest spread over the threads. The face
+    // connectivity is kept, so the new positions must match the loaded
+    // vertex count. Counts the meshes that had to be rebuilt in rebuilt.
+    bool update_vertices(const std::vector<point3> &positions,
+                         const double max_cost_ratio = 1.5,
+                         size_t *rebuilt = nullptr);
+
+    // Bytes used by the geometry and acceleration structures.
+    size_t memory_usage() const;
+
+    // Fills replica with a deep copy of this scene allocated by the calling
+    // thread.
+    void replicate(Scene &replica) const;
 };
-bool scene_from_xml_file(Scene &scene, const char *path);
+
+// How scene_from_xml_file() loads the meshes of a scene.
+enum class Geometry {
+    // Leaves scene.vertices and scene.hittables empty, for scenes whose
+    // geometry is streamed from a chunk file instead. The geometry is
+    // skipped while the file is read, see stream_scene_file().
+    None,
+    Meshes,
+    // Replaces every mesh with a CompactMesh as soon as it is parsed and
+    // releases the shared vertex data after the last one, so the full
+    // precision geometry is never resident at once. Animated updates are
+    // not possible afterwards.
+    Compact
+};
+
+bool scene_from_xml_file(Scene &scene, const char *path,
+                         const Geometry geometry = Geometry::Meshes);
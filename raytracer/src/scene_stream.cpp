@@ -0,0 +1,157 @@
+#include "scene_stream.h"
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace {
+class BlockReader {
+  public:
+    explicit BlockReader(FILE *file)
+        : m_file{file} {
+    }
+
+    int get() {
+        if (m_pos == m_len) {
+            m_len = fread(m_buffer, 1, sizeof(m_buffer), m_file);
+            m_pos = 0;
+            if (m_len == 0)
+                return EOF;
+        }
+        return static_cast<unsigned char>(m_buffer[m_pos++]);
+    }
+
+  private:
+    FILE *m_file;
+    char m_buffer[1 << 16];
+    size_t m_pos{0}, m_len{0};
+};
+
+enum class Text { Copy, Vertices, Faces, Material };
+
+struct Scanner {
+    Scanner(std::string &description, GeometryVisitor *visitor)
+        : description(description)
+        , visitor{visitor} {
+    }
+
+    std::string &description;
+    GeometryVisitor *visitor;
+    Text text{Text::Copy};
+    std::string token;
+    double xyz[3];
+    int n_coords{0};
+    std::string material_id;
+    std::vector<int> indices;
+    bool ok{true};
+
+    // Converts the number collected in token.
+    void number() {
+        if (token.empty())
+            return;
+        char *end;
+        if (text == Text::Vertices) {
+            xyz[n_coords++] = strtod(token.c_str(), &end);
+            if (n_coords == 3) {
+                n_coords = 0;
+                ok = ok && visitor->vertex(point3(xyz[0], xyz[1], xyz[2]));
+            }
+        } else {
+            indices.push_back(static_cast<int>(strtol(token.c_str(), &end,
+                                                      10)));
+        }
+        if (*end != '\0') {
+            std::cerr << "Error: " << token << " is not a number." << std::endl;
+            ok = false;
+        }
+        token.clear();
+    }
+
+    void character(const char c) {
+        if (text == Text::Copy || text == Text::Material) {
+            description += c;
+            if (text == Text::Material)
+                material_id += c;
+        } else if (visitor) {
+            if (isspace(static_cast<unsigned char>(c)))
+                number();
+            else
+                token += c;
+        }
+    }
+
+    void tag(const std::string &t) {
+        description += t;
+        if (t.compare(0, 2, "<?") == 0 || t.compare(0, 2, "<!") == 0)
+            return;
+
+        bool closing = t[1] == '/';
+        size_t begin = closing ? 2 : 1;
+        size_t end = t.find_first_of(" \t\r\n/>", begin);
+        std::string name = t.substr(begin, end - begin);
+        bool empty = t[t.size() - 2] == '/';
+
+        if (name == "vertexdata" || name == "faces") {
+            if (visitor)
+                number();
+            text = closing || empty ? Text::Copy
+                                    : (name == "faces" ? Text::Faces
+                                                       : Text::Vertices);
+        } else if (name == "materialid") {
+            if (!closing && !empty)
+                material_id.clear();
+            text = closing || empty ? Text::Copy : Text::Material;
+        } else if (name == "mesh" && !closing) {
+            material_id.clear();
+            indices.clear();
+        } else if (name == "mesh" && visitor) {
+            size_t first = material_id.find_first_not_of(" \t\r\n");
+            size_t last = material_id.find_last_not_of(" \t\r\n");
+            std::string id = first == std::string::npos
+                                 ? std::string()
+                                 : material_id.substr(first, last - first + 1);
+            ok = ok && visitor->mesh(id, indices);
+            std::vector<int>().swap(indices);
+        }
+    }
+};
+} // namespace
+
+bool stream_scene_file(const char *path, std::string &description,
+                       GeometryVisitor *visitor) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        std::cerr << "Error: Can't open input file!" << std::endl;
+        return false;
+    }
+
+    BlockReader reader{file};
+    Scanner scanner(description, visitor);
+    description.clear();
+    std::string t;
+    for (int c = reader.get(); c != EOF && scanner.ok; c = reader.get()) {
+        if (c != '<') {
+            scanner.character(static_cast<char>(c));
+            continue;
+        }
+
+        // Comments and declarations may contain '>', so they end with the
+        // matching sequence instead.
+        t = "<";
+        const char *close = ">";
+        while ((c = reader.get()) != EOF) {
+            t += static_cast<char>(c);
+            if (t == "<!--")
+                close = "-->";
+            else if (t == "<![CDATA[")
+                close = "]]>";
+            size_t n = strlen(close);
+            if (t.size() > n && t.compare(t.size() - n, n, close) == 0)
+                break;
+        }
+        scanner.tag(t);
+    }
+    fclose(file);
+    return scanner.ok;
+}
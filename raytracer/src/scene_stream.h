@@ -0,0 +1,24 @@
+#pragma once
+
+#include "vec3.h"
+#include <string>
+#include <vector>
+
+// Receives the geometry of a scene file while it is streamed, one vertex and
+// one mesh at a time.
+class GeometryVisitor {
+  public:
+    virtual ~GeometryVisitor() = default;
+
+    virtual bool vertex(const point3 &p) = 0;
+    // Called at the end of every <mesh> with its 1-based face indices.
+    virtual bool mesh(const std::string &material_id,
+                      std::vector<int> &indices) = 0;
+};
+
+// Reads the scene file at path in fixed size blocks. Everything but the text
+// of the <vertexdata> and <faces> elements is copied to description, which
+// stays small enough to parse as a document. The geometry is handed to
+// visitor instead, if one is given, so it is never held in memory as text.
+bool stream_scene_file(const char *path, std::string &description,
+                       GeometryVisitor *visitor);
@@ -4,6 +4,8 @@
 #include <sstream>
 #include "scene.h"
 #include "mesh.h"
+#include "compact_mesh.h"
+#include "scene_stream.h"
 
 using namespace pugi;
 using namespace std;
@@ -55,11 +57,22 @@ inline bool is_valid(const char_t *p, const string &id, const string &error_msg,
     return is_valid(p, id + error_msg, err);
 }
 
-bool scene_from_xml_file(Scene &scene, const char *path) {
+bool scene_from_xml_file(Scene &scene, const char *path,
+                         const Geometry geometry) {
     bool err = true;
 
+    // Without geometry, the vertices and faces are skipped while the file
+    // is read so that scenes larger than memory can be described.
     xml_document doc;
-    doc.load_file(path, parse_trim_pcdata);
+    if (geometry == Geometry::None) {
+        string description;
+        if (!stream_scene_file(path, description, nullptr))
+            return false;
+        doc.load_buffer(description.data(), description.size(),
+                        parse_trim_pcdata);
+    } else {
+        doc.load_file(path, parse_trim_pcdata);
+    }
 
     if (!doc.first_child()) {
         cerr << "Error: Can't open input file!" << endl;
@@ -149,6 +162,9 @@ bool scene_from_xml_file(Scene &scene, const char *path) {
         scene.materials.push_back(m);
     }
 
+    if (geometry == Geometry::None)
+        return err;
+
     if (is_valid(sc.child_value("vertexdata"), ".vertexdata", err))
         scene.vertices = str_to_vv3(sc.child_value("vertexdata"));
 
@@ -156,11 +172,21 @@ bool scene_from_xml_file(Scene &scene, const char *path) {
         string id = o.attribute("id").value();
         if (is_valid(o.child_value("materialid"), id, ".materialid", err) &&
             is_valid(o.child_value("faces"), id, ".faces", err)) {
-            scene.hittables.push_back(
+            Hittable *mesh =
                 new Mesh(scene.vertices, tokenize_int(o.child_value("faces")),
-                         o.child_value("materialid")));
+                         o.child_value("materialid"));
+            if (geometry == Geometry::Compact) {
+                Hittable *compact =
+                    new CompactMesh(*static_cast<Mesh *>(mesh));
+                delete mesh;
+                mesh = compact;
+            }
+            scene.hittables.push_back(mesh);
         }
     }
 
+    if (geometry == Geometry::Compact)
+        vector<point3>().swap(scene.vertices);
+
     return err;
 }
\ No newline at end of file